@@ -9,11 +9,27 @@
 #include <linux/random.h>           /* For inital seed */
 #include <linux/proc_fs.h>          /* For /proc filesystem */
 #include <linux/seq_file.h>         /* For seq_print */
-#include <linux/mutex.h>
+#include <linux/spinlock.h>        /* For the atomic-context safe locks */
 #include <linux/atomic.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>           /* For the load time */
+#include <linux/percpu.h>           /* For the per-CPU generator state */
+#include <linux/workqueue.h>        /* For the parallel read workers */
+#include <linux/cpumask.h>          /* For num_online_cpus */
+#include <linux/bitops.h>           /* For hweight64 */
+#include <linux/moduleparam.h>      /* For the health test and QoS tunables */
+#include <linux/log2.h>             /* For the latency histogram */
+#include <linux/math64.h>           /* For div_u64 */
+#include <linux/sched.h>            /* For cond_resched */
+#include <linux/string.h>           /* For memcpy_flushcache */
+#include <linux/mm.h>               /* For pin_user_pages_fast */
+#include <linux/highmem.h>          /* For kmap_local_page */
+#include <linux/sort.h>             /* For sorting /proc/srandom_consumers */
+#include <linux/hash.h>             /* For hash_64 */
+#include <crypto/internal/rng.h>   /* For crypto_register_rng */
 #include "chacha.h"                 /* For chacha */
+#include "srandom.h"                /* For the exported in-kernel API */
 
 #define DRIVER_AUTHOR "Jonathan Senkerik <josenk@jintegrate.co>"
 #define DRIVER_DESC   "Improved random number generator."
@@ -24,6 +40,35 @@
 #define rndArraySize 67             /* Size of Array.  Must be >= 65. */
 #define THREAD_SLEEP_VALUE 601      /* Amount of time in seconds, the background thread should sleep between each operation. */
 #define PAID 0
+#define PARALLEL_READ_MIN (1024 * 1024)  /* Reads of at least this many bytes are generated by the worker pool */
+#define PARALLEL_CHUNK_SIZE (64 * 1024)  /* Bytes generated by one worker at a time */
+#define PARALLEL_MAX_CHUNKS 16           /* Maximum chunks in flight for one read */
+#define SMALL_READ_MAX 512               /* Reads up to this many bytes are latency sensitive (small read class) */
+#define RESERVED_SMALL_ARRAYS 8          /* Arrays only handed out to small reads, so bulk readers can not take them all */
+#define BULK_SLICE_SIZE (64 * 1024)      /* Bulk reads are generated and throttled this many bytes at a time */
+#define BULK_NOCACHE_MIN (64 * 1024)     /* Default: bulk reads of at least this many bytes bypass the CPU caches */
+#define NOCACHE_BATCH_SIZE (1024 * 1024) /* User memory pinned at a time by the no-cache bulk mode */
+#define FAST_FILL_IRQ_MAX 256            /* Bytes srandom_fill_fast generates per interrupts-off section */
+#define CONSUMER_SLOTS 256               /* Consumer accounting hash slots per CPU.  Must be a power of 2. */
+#define CONSUMER_PROBES 8                /* Slots probed before a consumer is counted as "other" */
+#define CONSUMERS_TOP_N 20               /* Default number of consumers listed in /proc/srandom_consumers */
+#define LATENCY_BUCKETS 32               /* log2(ns) latency histogram buckets, the last one holds >= 2s */
+#define READ_CLASS_SMALL 0
+#define READ_CLASS_BULK 1
+#define READ_CLASSES 2
+#define HEALTH_SAMPLE_RATE 1024          /* Default: health test 1 in this many served blocks.  0 disables. */
+#define HEALTH_APT_CUTOFF 20             /* Adaptive proportion cutoff, 512 byte window, H=8 (false alarm ~2^-40) */
+#define HEALTH_MONOBIT_LIMIT 256         /* Max distance of the 4096 bit block's one count from 2048 (8 sigma) */
+#define HEALTH_FAIL_RCT 1
+#define HEALTH_FAIL_APT 2
+#define HEALTH_FAIL_MONOBIT 4
+#define HEALTH_FAIL_STUCK 8
+#if ULTRA_HIGH_SPEED_MODE
+    #define SRANDOM_DRIVER_NAME "srandom-uhs"
+#else
+    #define SRANDOM_DRIVER_NAME "srandom-chacha8"
+#endif
+#define SRANDOM_RNG_PRIORITY 100    /* crypto_rng priority.  Kept low so "stdrng" is never resolved to srandom. */
 
 
 //#define DEBUG_CONNECTIONS 0
@@ -34,6 +79,33 @@
 //#define DEBUG_THREAD 0
 //#define DEBUG_CHACHA 0
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,2,0)
+    #define SRANDOM_CRYPTO_RNG 1    /* crypto_register_rng() and the rng_alg generate/seed API */
+#endif
+
+/*
+ * The kfuncs are UHS only, where they take no locks.  ChaCha mode goes through the array
+ * spinlocks, which a program running inside the locked region would deadlock on.
+ */
+#if IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES) && LINUX_VERSION_CODE >= KERNEL_VERSION(6,9,0) && ULTRA_HIGH_SPEED_MODE
+    #include <linux/btf.h>          /* For register_btf_kfunc_id_set */
+    #include <linux/btf_ids.h>      /* For BTF_KFUNCS_START */
+    #define SRANDOM_BPF_KFUNCS 1    /* bpf_srandom_u64 and bpf_srandom_fill kfuncs */
+#endif
+
+/*
+ * memcpy_flushcache only uses non-temporal stores on x86-64.  Elsewhere it is a cached copy
+ * followed by a cache flush, which is no better than the normal path.
+ */
+#if IS_ENABLED(CONFIG_X86_64) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+    #define SRANDOM_NOCACHE 1       /* pin_user_pages_fast and kmap_local_page for the no-cache bulk mode */
+#endif
+
+#if IS_ENABLED(CONFIG_CGROUPS) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+    #include <linux/cgroup.h>       /* For task_dfl_cgroup and cgroup_id */
+    #define SRANDOM_CGROUP_ID 1     /* Consumers are keyed by cgroup v2 id */
+#endif
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
     #define COPY_TO_USER raw_copy_to_user
     #define COPY_FROM_USER raw_copy_from_user
@@ -63,16 +135,35 @@ static int device_open(struct inode *, struct file *);
 static int device_release(struct inode *, struct file *);
 static ssize_t sdevice_read(struct file *, char *, size_t, loff_t *);
 static ssize_t sdevice_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t sdevice_read_parallel(char *, size_t);
+static ssize_t sdevice_read_copy(char *, size_t);
+#ifdef SRANDOM_NOCACHE
+static ssize_t sdevice_read_nocache(char *, size_t);
+static void nocache_fill(struct page **, size_t, size_t);
+#endif
+static void chunk_work(struct work_struct *);
 static uint64_t wyhash64(void);
 static uint64_t lcg_fast(void);
 static uint64_t xoshiro256pp(void);
 static inline uint64_t rotl(uint64_t, int);
 static inline uint64_t rotr(uint64_t, int);
 
+static void init_sarray(int);
 static void update_sarray(int);
-static uint8_t get_next_buffer(void);
+static uint8_t get_next_buffer(bool);
+static void release_buffer(uint8_t);
+static void srandom_fill(uint8_t *, size_t, bool);
+static void srandom_fill_fast(uint8_t *, size_t);
+static int bulk_throttle(size_t);
+static void record_latency(int, u64);
+static void account_consumer(size_t, u64);
+static void read_done(int, ssize_t, u64);
+static int health_test(int);
+static void health_failed(int, int);
 static int proc_read(struct seq_file *m, void *v);
 static int proc_open(struct inode *inode, struct  file *file);
+static int consumers_proc_read(struct seq_file *m, void *v);
+static int consumers_proc_open(struct inode *inode, struct  file *file);
 static void shuffle_sarray(int);
 static uint64_t swapInt64(uint64_t);
 static uint64_t reverseInt64(uint64_t);
@@ -106,6 +197,12 @@ static struct proc_ops proc_fops={
       .proc_read = seq_read,
       .proc_lseek = seq_lseek
 };
+static struct proc_ops consumers_proc_fops={
+      .proc_open = consumers_proc_open,
+      .proc_release = single_release,
+      .proc_read = seq_read,
+      .proc_lseek = seq_lseek
+};
 #else
 static const struct file_operations proc_fops = {
         .owner   = THIS_MODULE,
@@ -114,26 +211,153 @@ static const struct file_operations proc_fops = {
         .llseek  = seq_lseek,
         .release = single_release,
 };
+static const struct file_operations consumers_proc_fops = {
+        .owner   = THIS_MODULE,
+        .read    = seq_read,
+        .open    = consumers_proc_open,
+        .llseek  = seq_lseek,
+        .release = single_release,
+};
+#endif
+
+
+#ifdef SRANDOM_CRYPTO_RNG
+static int srandom_rng_generate(struct crypto_rng *tfm, const u8 *src, unsigned int slen, u8 *dst, unsigned int dlen);
+static int srandom_rng_seed(struct crypto_rng *tfm, const u8 *seed, unsigned int slen);
+
+static struct rng_alg srandom_rng_alg = {
+        .generate = srandom_rng_generate,
+        .seed     = srandom_rng_seed,
+        .seedsize = 0,
+        .base     = {
+                .cra_name        = SDEVICE_NAME,
+                .cra_driver_name = SRANDOM_DRIVER_NAME,
+                .cra_priority    = SRANDOM_RNG_PRIORITY,
+                .cra_ctxsize     = 0,
+                .cra_module      = THIS_MODULE,
+        }
+};
+static bool rngRegistered;
 #endif
 
+#ifdef SRANDOM_BPF_KFUNCS
+BTF_KFUNCS_START(srandom_kfunc_ids)
+BTF_ID_FLAGS(func, bpf_srandom_u64)
+BTF_ID_FLAGS(func, bpf_srandom_fill)
+BTF_KFUNCS_END(srandom_kfunc_ids)
+
+static const struct btf_kfunc_id_set srandom_kfunc_set = {
+        .owner = THIS_MODULE,
+        .set   = &srandom_kfunc_ids,
+};
+#endif
 
-static struct mutex UpArr_mutex[numberOfRndArrays];
-static struct mutex ArrBusy_mutex;
-static struct chacha_context ctx;
+
+/*
+ * Spinlocks (not mutexes) so the arrays can be used from atomic context.
+ */
+static spinlock_t UpArr_lock[numberOfRndArrays];
+static DEFINE_SPINLOCK(ArrBusy_lock);
+static DEFINE_SPINLOCK(chacha_lock);
+static DEFINE_SPINLOCK(bulkThrottle_lock);
 static struct task_struct *kthread;
+static struct workqueue_struct *srandom_wq;
+
+
+/*
+ * Generator state.  One per CPU, so concurrent readers and workers never share it.
+ * Only use it with preemption disabled (all callers hold a spinlock).
+ */
+struct srandom_state {
+        uint64_t wyhash64_x;                  /* x for wyhash64 */
+        uint64_t lcg_state;                   /* state for fast LCG in-module use only */
+        uint64_t xoroshiro_s[4];              /* s for xoroshiro256** */
+        uint64_t last_wyhash64_x;             /* wyhash64_x at the last health test, for the stuck state test */
+};
+static DEFINE_PER_CPU(struct srandom_state, srandom_states);
+static DEFINE_PER_CPU(unsigned int, healthSampleCount);
+
+
+/*
+ * Health test tunables
+ */
+static unsigned int health_sample_rate = HEALTH_SAMPLE_RATE;
+module_param(health_sample_rate, uint, 0644);
+MODULE_PARM_DESC(health_sample_rate, "Health test 1 in N served blocks (0 disables)");
+
+
+/*
+ * Read QoS.  Small reads get reserved arrays, bulk reads can be capped.
+ */
+static unsigned int bulk_bw_cap = 0;
+module_param(bulk_bw_cap, uint, 0644);
+MODULE_PARM_DESC(bulk_bw_cap, "Bandwidth cap in MiB/s shared by all bulk reads (0 is unlimited)");
+
+struct read_latency {
+        u64 count;
+        u64 totalNs;
+        u64 maxNs;
+        u64 hist[LATENCY_BUCKETS];            /* hist[b] counts reads that took [2^b, 2^(b+1)) ns */
+};
+static DEFINE_PER_CPU(struct read_latency, readLatency[READ_CLASSES]);
+static u64 bulkNextNs;                        /* Bulk throttle.  When the next bulk slice may start. */
+
+static unsigned int bulk_nocache_min = BULK_NOCACHE_MIN;
+module_param(bulk_nocache_min, uint, 0644);
+MODULE_PARM_DESC(bulk_nocache_min, "Bulk reads of at least this many bytes are written with non-temporal stores (0 disables)");
+
+
+/*
+ * Per consumer usage accounting.  Each CPU has its own open addressing hash table (alloc_percpu,
+ * too large for static per-CPU data), so sdevice_read only needs preemption off to update it.
+ * /proc/srandom_consumers merges them.
+ */
+struct srandom_consumer {
+        u64 cgroupId;                         /* cgroup v2 id (the inode number of its /sys/fs/cgroup directory) */
+        pid_t tgid;                           /* Process, when consumers_by_tgid is set.  Otherwise 0. */
+        bool used;
+        char comm[TASK_COMM_LEN];             /* First process seen for this consumer */
+        u64 bytes;
+        u64 reads;
+        u64 readNs;                           /* Time spent in sdevice_read */
+};
+struct consumer_table {
+        struct srandom_consumer slots[CONSUMER_SLOTS];
+        struct srandom_consumer other;        /* Usage of consumers evicted from their slot */
+};
+static struct consumer_table __percpu *consumerTables;
+
+static bool consumers_by_tgid = 0;
+module_param(consumers_by_tgid, bool, 0644);
+MODULE_PARM_DESC(consumers_by_tgid, "Account usage per process (TGID) within each cgroup");
+
+static unsigned int consumers_top_n = CONSUMERS_TOP_N;
+module_param(consumers_top_n, uint, 0644);
+MODULE_PARM_DESC(consumers_top_n, "Number of consumers listed in /proc/srandom_consumers");
+
+
+/*
+ * One chunk of a parallel read, generated by a srandom_wq worker.
+ * Written to buf, or straight into pinned user pages (starting offset bytes into pages[0]) in no-cache mode.
+ */
+struct srandom_chunk {
+        struct work_struct work;
+        uint8_t *buf;
+        struct page **pages;
+        size_t offset;
+        size_t count;
+};
 
 
 /*
  * Global variables
  */
-uint64_t wyhash64_x;                      /* x for wyhash64 */
-uint64_t lcg_state;                       /* state for fast LCG in-module use only */
-uint64_t xoroshiro_s[4];                  /* s for xoroshiro256** */
 uint8_t chacha_key[32];
 uint8_t chacha_nonce[12];
-uint64_t chacha_counter =0;
+uint64_t chacha_counter =0;                /* Next unused 64 byte ChaCha key stream block */
 uint64_t (*prngArrays)[rndArraySize];     /* Array of Array of SECURE RND numbers */
 int8_t ArraysBusyFlags[numberOfRndArrays];     /* Binary Flags for Busy Arrays */
+int8_t ArraysInitFlags[numberOfRndArrays];     /* Binary Flags for Arrays filled on first use */
 
 
 /*
@@ -141,7 +365,14 @@ int8_t ArraysBusyFlags[numberOfRndArrays];     /* Binary Flags for Busy Arrays *
  */
 atomic_t sdevOpenCurrent;          /* srandom device current open count */
 atomic_t sdevOpenTotal;            /* srandom device total open count */
-uint64_t generatedCount;           /* Total generated (512byte) */
+DEFINE_PER_CPU(uint64_t, generatedCount);     /* Total generated (512byte) */
+atomic64_t healthSamples;          /* Blocks health tested */
+atomic_t healthFailRCT;            /* Repetition count test failures */
+atomic_t healthFailAPT;            /* Adaptive proportion test failures */
+atomic_t healthFailMonobit;        /* Monobit test failures */
+atomic_t healthFailStuck;          /* Stuck generator state detections */
+atomic_t healthReseeds;            /* Reseeds after a failed health test */
+s64 loadTimeUs;                    /* Time mod_init took to get /dev/srandom ready */
 
 
 /*
@@ -149,35 +380,115 @@ uint64_t generatedCount;           /* Total generated (512byte) */
  */
 int mod_init(void)
 {
-        int16_t C,buffer_id;
+        int16_t C;
+        int cpu;
+        ktime_t loadStart = ktime_get();
 
         atomic_set(&sdevOpenCurrent, 0);
         atomic_set(&sdevOpenTotal, 0);
-        generatedCount  = 0;
+        atomic64_set(&healthSamples, 0);
+        atomic_set(&healthFailRCT, 0);
+        atomic_set(&healthFailAPT, 0);
+        atomic_set(&healthFailMonobit, 0);
+        atomic_set(&healthFailStuck, 0);
+        atomic_set(&healthReseeds, 0);
 
         for (C = 0; C < numberOfRndArrays; C++) {
-                mutex_init(&UpArr_mutex[C]);
+                spin_lock_init(&UpArr_lock[C]);
+                ArraysInitFlags[C] = 0;
+        }
+
+        /*
+         * Allocate the arrays up front.  Each one is filled on its first use (init_sarray).
+         */
+        prngArrays = kmalloc(numberOfRndArrays * rndArraySize * sizeof(uint64_t), GFP_KERNEL);
+        if (!prngArrays) {
+                printk(KERN_INFO "[srandom] mod_init kmalloc failed to allocate initial memory.\n");
+                return -ENOMEM;
+        }
+
+        //  Seed everything
+        for_each_possible_cpu(cpu) {
+                get_random_bytes(per_cpu_ptr(&srandom_states, cpu), sizeof(struct srandom_state));
+        }
+
+        consumerTables = alloc_percpu(struct consumer_table);
+        if (!consumerTables)
+                printk(KERN_INFO "[srandom] mod_init alloc_percpu failed, consumer accounting disabled..\n");
+
+        /*
+         * Workers for large reads.  Failing here only disables parallel reads.
+         */
+        srandom_wq = alloc_workqueue("srandom", WQ_UNBOUND, 0);
+        if (!srandom_wq)
+                printk(KERN_INFO "[srandom] mod_init alloc_workqueue failed, parallel reads disabled..\n");
+
+        kthread = kthread_create(work_thread, NULL, "srandom-kthread");
+        if (IS_ERR(kthread)) {
+                printk(KERN_INFO "[srandom] mod_init kthread_create failed..\n");
+                if (srandom_wq)
+                        destroy_workqueue(srandom_wq);
+                free_percpu(consumerTables);
+                kfree(prngArrays);
+                return PTR_ERR(kthread);
         }
-        mutex_init(&ArrBusy_mutex);
+        wake_up_process(kthread);
 
         /*
-         * Register char device
+         * Register char device.  Done last, so the first read always finds the arrays ready.
          */
-        if (misc_register(&srandom_dev))
+        if (misc_register(&srandom_dev)) {
                 printk(KERN_INFO "[srandom] mod_init /dev/srandom driver registion failed..\n");
-        else
-                printk(KERN_INFO "[srandom] mod_init /dev/srandom driver registered..\n");
+                kthread_stop(kthread);
+                if (srandom_wq)
+                        destroy_workqueue(srandom_wq);
+                free_percpu(consumerTables);
+                kfree(prngArrays);
+                return -ENODEV;
+        }
+        printk(KERN_INFO "[srandom] mod_init /dev/srandom driver registered..\n");
 
         /*
          * Create /proc/srandom
          */
-        // if (! proc_create("srandom", 0, NULL, &proc_fops))
         if (! proc_create("srandom", 0, NULL, &proc_fops))
                 printk(KERN_INFO "[srandom] mod_init /proc/srandom registion failed..\n");
         else
                 printk(KERN_INFO "[srandom] mod_init /proc/srandom registion regisered..\n");
 
+        if (! proc_create("srandom_consumers", 0400, NULL, &consumers_proc_fops))
+                printk(KERN_INFO "[srandom] mod_init /proc/srandom_consumers registion failed..\n");
+        else
+                printk(KERN_INFO "[srandom] mod_init /proc/srandom_consumers registion regisered..\n");
+
+        /*
+         * Register with the crypto API (AF_ALG "rng" sockets and crypto_alloc_rng("srandom"))
+         */
+        #ifdef SRANDOM_CRYPTO_RNG
+        if (crypto_register_rng(&srandom_rng_alg)) {
+                printk(KERN_INFO "[srandom] mod_init crypto_rng "SRANDOM_DRIVER_NAME" registion failed..\n");
+        } else {
+                rngRegistered = 1;
+                printk(KERN_INFO "[srandom] mod_init crypto_rng "SRANDOM_DRIVER_NAME" registered..\n");
+        }
+        #endif
+
+        /*
+         * Make the kfuncs available to XDP and tc programs.  Not to tracing programs: those can run
+         * in NMI or inside the generators, and interrupt this CPU's generator state mid update.
+         */
+        #ifdef SRANDOM_BPF_KFUNCS
+        if (register_btf_kfunc_id_set(BPF_PROG_TYPE_XDP, &srandom_kfunc_set) ||
+            register_btf_kfunc_id_set(BPF_PROG_TYPE_SCHED_CLS, &srandom_kfunc_set))
+                printk(KERN_INFO "[srandom] mod_init BPF kfuncs registion failed..\n");
+        else
+                printk(KERN_INFO "[srandom] mod_init BPF kfuncs registered..\n");
+        #endif
+
+        loadTimeUs = ktime_us_delta(ktime_get(), loadStart);
+
         printk(KERN_INFO "[srandom] mod_init Module version         : "APP_VERSION"\n");
+        printk(KERN_INFO "[srandom] mod_init Module load time (us)  : %lld\n", loadTimeUs);
         if (PAID == 0) {
                 printk(KERN_INFO "-----------------------:----------------------\n");
                 printk(KERN_INFO "Please support my work and efforts contributing\n");
@@ -194,36 +505,6 @@ int mod_init(void)
                 printk(KERN_INFO "Commercial Invoice     : Avail on request.\n");
         }
 
-
-        prngArrays = kmalloc((numberOfRndArrays + 1) * rndArraySize * sizeof(uint64_t), GFP_KERNEL);
-        while (!prngArrays) {
-                printk(KERN_INFO "[srandom] mod_init kmalloc failed to allocate initial memory.  retrying...\n");
-                prngArrays = kmalloc((numberOfRndArrays + 1) * rndArraySize * sizeof(uint64_t), GFP_KERNEL);
-        }
-
-        //  Seed everything
-        get_random_bytes(&wyhash64_x, sizeof(uint64_t));
-        get_random_bytes(&lcg_state, sizeof(uint64_t));
-        get_random_bytes(&xoroshiro_s[0], sizeof(uint64_t));
-        get_random_bytes(&xoroshiro_s[1], sizeof(uint64_t));
-        get_random_bytes(&xoroshiro_s[2], sizeof(uint64_t));
-        get_random_bytes(&xoroshiro_s[3], sizeof(uint64_t));
-
-        chacha_init_context(&ctx, chacha_key, chacha_nonce, chacha_counter);
-
-        /*
-         * Init the sarray
-         */
-        for (buffer_id = 0;buffer_id <= numberOfRndArrays ;buffer_id++) {
-                for (C = 0;C < rndArraySize;C++) {
-                        prngArrays[buffer_id][C] = wyhash64() ^ xoshiro256pp();
-                }
-                update_sarray(buffer_id);
-        }
-
-        kthread = kthread_create(work_thread, NULL, "srandom-kthread");
-        wake_up_process(kthread);
-
         return 0;
 }
 
@@ -232,12 +513,22 @@ int mod_init(void)
  */
 void mod_exit(void)
 {
+        #ifdef SRANDOM_CRYPTO_RNG
+        if (rngRegistered)
+                crypto_unregister_rng(&srandom_rng_alg);
+        #endif
+
         kthread_stop(kthread);
 
         misc_deregister(&srandom_dev);
 
         remove_proc_entry("srandom", NULL);
+        remove_proc_entry("srandom_consumers", NULL);
+
+        if (srandom_wq)
+                destroy_workqueue(srandom_wq);
 
+        free_percpu(consumerTables);
         kfree(prngArrays);
 
         printk(KERN_INFO "[srandom] mod_exit srandom deregisered..\n");
@@ -280,68 +571,92 @@ static int device_release(struct inode *inode, struct file *file)
  */
 static ssize_t sdevice_read(struct file * file, char * buf, size_t requestedCount, loff_t *ppos)
 {
-        int Block, ret;
-        uint8_t buffer_id;
-        char *new_buf;                 /* Buffer to hold numbers to send */
-        bool isVMalloc = 0;
+        ssize_t ret = 0;
+        uint8_t smallBuf[SMALL_READ_MAX];
+        size_t done;
+        u64 readStart = ktime_get_ns();
 
 
         #ifdef DEBUG_READ
         printk(KERN_INFO "[srandom] sdevice_read requestedCount:%zu\n", requestedCount);
         #endif
 
+        /*
+         * Small reads.  No allocation, and served from the reserved arrays first.
+         */
+        if (requestedCount <= SMALL_READ_MAX) {
+                srandom_fill(smallBuf, requestedCount, 1);
+                ret = COPY_TO_USER(buf, smallBuf, requestedCount) ? -EFAULT : requestedCount;
 
-        new_buf = kmalloc((requestedCount + 512) * sizeof(uint8_t), GFP_KERNEL|__GFP_NOWARN);
-        while (!new_buf) {
-                #ifdef DEBUG_READ
-                printk(KERN_INFO "[srandom] using vmalloc to allocate large blocksize.\n");
-                #endif
+                read_done(READ_CLASS_SMALL, ret, readStart);
+                return ret;
+        }
 
-                isVMalloc = 1;
-                new_buf = vmalloc((requestedCount + 512) * sizeof(uint8_t));
+        #ifdef SRANDOM_NOCACHE
+        if (bulk_nocache_min && requestedCount >= bulk_nocache_min)
+                ret = sdevice_read_nocache(buf, requestedCount);
+        #endif
+
+        /*
+         * Whatever the no-cache mode did not write (memory it can not pin, such as VM_IO or
+         * VM_PFNMAP mappings) goes through the copy paths.
+         */
+        if (ret >= 0 && (size_t)ret < requestedCount) {
+                done = ret;
+                ret  = -ENOMEM;
+                if (requestedCount - done >= PARALLEL_READ_MIN && srandom_wq && num_online_cpus() > 1)
+                        ret = sdevice_read_parallel(buf + done, requestedCount - done);
+                if (ret == -ENOMEM)
+                        ret = sdevice_read_copy(buf + done, requestedCount - done);
+
+                if (ret >= 0)
+                        ret += done;
+                else if (done)
+                        ret = done;
         }
 
-        for (Block = 0; Block <= (requestedCount / 512); Block++) {
-                buffer_id = get_next_buffer();
-                generatedCount++;
+        read_done(READ_CLASS_BULK, ret, readStart);
+        return ret;
+}
 
-                /*
-                 * Fill new_buf from a prngArrays block until requestedCount is met.
-                 */
-                #ifdef DEBUG_READ
-                printk(KERN_INFO "[srandom] Block:%u buffer_id:%d\n", Block, buffer_id);
-                #endif
 
-                memcpy(new_buf + (Block * 512), prngArrays[buffer_id], 512);
-                
-                #if ULTRA_HIGH_SPEED_MODE
-                // UHS mode will update the prngArrays block with new values for next request.
-                update_sarray(buffer_id);
+/*
+ * Bulk reads without no-cache or parallel generation.  Generated into a kernel buffer, then copied.
+ */
+static ssize_t sdevice_read_copy(char * buf, size_t requestedCount)
+{
+        ssize_t ret;
+        char *new_buf;                 /* Buffer to hold numbers to send */
+        bool isVMalloc = 0;
+        size_t done, slice;
+        int err = 0;
+
+        new_buf = kmalloc(requestedCount * sizeof(uint8_t), GFP_KERNEL|__GFP_NOWARN);
+        while (!new_buf) {
+                #ifdef DEBUG_READ
+                printk(KERN_INFO "[srandom] using vmalloc to allocate large blocksize.\n");
                 #endif
 
-                /*
-                 * Clear ArraysBusyFlags
-                 */
-                if (mutex_lock_interruptible(&ArrBusy_mutex))
-                        return -ERESTARTSYS;
-                ArraysBusyFlags[buffer_id] = 0;
-                mutex_unlock(&ArrBusy_mutex);
+                isVMalloc = 1;
+                new_buf = vmalloc(requestedCount * sizeof(uint8_t));
         }
 
-        //  Use Chacha to cipher new_buf
-        #if ! ULTRA_HIGH_SPEED_MODE
-        //printk(KERN_INFO "[srandom] preChaCha 0:%d last:%d\n", (uint8_t)new_buf[0], (uint8_t)new_buf[sizeof(new_buf) -1]);
-
-        chacha_xor(&ctx, new_buf, requestedCount);
-        chacha_counter += requestedCount;
-
-        //printk(KERN_INFO "[srandom] postChaCha 0:%d last:%d\n", (uint8_t)new_buf[0], (uint8_t)new_buf[sizeof(new_buf) -1]);
-        #endif
+        /*
+         * Bulk reads are generated a slice at a time, yielding and throttling in between.
+         */
+        for (done = 0; done < requestedCount; done += slice) {
+                slice = min_t(size_t, requestedCount - done, BULK_SLICE_SIZE);
+                err = bulk_throttle(slice);
+                if (err)
+                        break;
+                srandom_fill((uint8_t *)new_buf + done, slice, 0);
+                cond_resched();
+        }
 
         /*
          * Send new_buf to device
          */
-        ret = COPY_TO_USER(buf, new_buf, requestedCount);
+        ret = COPY_TO_USER(buf, new_buf, done) ? -EFAULT : done;
 
         /*
          * Free allocated memory
@@ -352,14 +667,340 @@ static ssize_t sdevice_read(struct file * file, char * buf, size_t requestedCoun
                 kfree(new_buf);
         }
 
-
         /*
          * return how many chars we sent
          */
-        return requestedCount;
+        return done ? ret : err;
+}
+
+
+/*
+ * Bulk read throttle.  All bulk readers share one virtual clock advanced by
+ * count bytes at bulk_bw_cap MiB/s, and sleep until their slice is due.
+ * Returns -ERESTARTSYS when a signal is pending, so a killed reader stops
+ * generating (and moving the clock) instead of finishing its read.
+ */
+static int bulk_throttle(size_t count)
+{
+        unsigned int cap = READ_ONCE(bulk_bw_cap);
+        u64 now, start, delayNs;
+
+        if (signal_pending(current))
+                return -ERESTARTSYS;
+        if (!cap)
+                return 0;
+
+        spin_lock(&bulkThrottle_lock);
+        now   = ktime_get_ns();
+        start = max(now, bulkNextNs);
+        bulkNextNs = start + div64_u64((u64)count * NSEC_PER_SEC, (u64)cap << 20);
+        spin_unlock(&bulkThrottle_lock);
+
+        delayNs = start - now;
+        if (delayNs >= NSEC_PER_MSEC) {
+                msleep_interruptible(div_u64(delayNs, NSEC_PER_MSEC));
+        } else if (delayNs >= 10 * NSEC_PER_USEC) {
+                usleep_range(div_u64(delayNs, NSEC_PER_USEC), div_u64(delayNs, NSEC_PER_USEC) + 50);
+        }
+
+        return signal_pending(current) ? -ERESTARTSYS : 0;
+}
+
+
+/*
+ * Account a finished read to its class and consumer
+ */
+static void read_done(int readClass, ssize_t count, u64 readStart)
+{
+        u64 ns = ktime_get_ns() - readStart;
+
+        record_latency(readClass, ns);
+        account_consumer(count > 0 ? count : 0, ns);
+}
+
+
+/*
+ * Add a read to the current consumer's slot in this CPU's table.
+ * When the probe window is full, the slot with the fewest bytes is evicted.  Its usage is
+ * folded into "other", so a stream of short lived processes or cgroups can not fill the table
+ * for good.
+ */
+static void account_consumer(size_t count, u64 ns)
+{
+        struct consumer_table *table;
+        struct srandom_consumer *consumer = NULL, *victim = NULL;
+        u64 cgroupId = 0;
+        pid_t tgid = consumers_by_tgid ? current->tgid : 0;
+        unsigned int hash, C;
+
+        if (!consumerTables)
+                return;
+
+        #ifdef SRANDOM_CGROUP_ID
+        rcu_read_lock();
+        cgroupId = cgroup_id(task_dfl_cgroup(current));
+        rcu_read_unlock();
+        #endif
+
+        hash  = hash_64(cgroupId ^ ((u64)tgid << 32), ilog2(CONSUMER_SLOTS));
+        table = get_cpu_ptr(consumerTables);
+
+        for (C = 0; C < CONSUMER_PROBES; C++) {
+                struct srandom_consumer *slot = &table->slots[(hash + C) & (CONSUMER_SLOTS - 1)];
+
+                if (!slot->used) {
+                        slot->cgroupId = cgroupId;
+                        slot->tgid     = tgid;
+                        get_task_comm(slot->comm, current);
+                        WRITE_ONCE(slot->used, 1);
+                }
+                if (slot->cgroupId == cgroupId && slot->tgid == tgid) {
+                        consumer = slot;
+                        break;
+                }
+                if (!victim || slot->bytes < victim->bytes)
+                        victim = slot;
+        }
+        if (!consumer) {
+                table->other.bytes  += victim->bytes;
+                table->other.reads  += victim->reads;
+                table->other.readNs += victim->readNs;
+
+                consumer = victim;
+                consumer->cgroupId = cgroupId;
+                consumer->tgid     = tgid;
+                consumer->bytes    = 0;
+                consumer->reads    = 0;
+                consumer->readNs   = 0;
+                get_task_comm(consumer->comm, current);
+        }
+
+        consumer->bytes  += count;
+        consumer->reads  += 1;
+        consumer->readNs += ns;
+
+        put_cpu_ptr(consumerTables);
+}
+
+
+/*
+ * Per class read latency.  Per-CPU, so readers never share a cache line here.
+ */
+static void record_latency(int readClass, u64 ns)
+{
+        struct read_latency *lat = get_cpu_ptr(&readLatency[readClass]);
+
+        lat->count++;
+        lat->totalNs += ns;
+        if (ns > lat->maxNs)
+                lat->maxNs = ns;
+        lat->hist[min_t(int, ilog2(ns | 1), LATENCY_BUCKETS - 1)]++;
+
+        put_cpu_ptr(&readLatency[readClass]);
+}
+
+
+/*
+ * Large reads are split into chunks generated in parallel by srandom_wq.
+ * Chunks are copied to the user in order while the following chunks are still being generated.
+ */
+static ssize_t sdevice_read_parallel(char * buf, size_t requestedCount)
+{
+        struct srandom_chunk *chunks;
+        uint8_t *chunkBufs;
+        size_t queued = 0, copied = 0, count;
+        int nrChunks, C, err = 0;
+
+        nrChunks = min_t(int, num_online_cpus(), PARALLEL_MAX_CHUNKS);
+        nrChunks = min_t(int, nrChunks, DIV_ROUND_UP(requestedCount, PARALLEL_CHUNK_SIZE));
+
+        chunks    = kcalloc(nrChunks, sizeof(struct srandom_chunk), GFP_KERNEL|__GFP_NOWARN);
+        chunkBufs = vmalloc(nrChunks * PARALLEL_CHUNK_SIZE);
+        if (!chunks || !chunkBufs) {
+                kfree(chunks);
+                vfree(chunkBufs);
+                return -ENOMEM;
+        }
+
+        for (C = 0; C < nrChunks; C++) {
+                INIT_WORK(&chunks[C].work, chunk_work);
+                chunks[C].buf   = chunkBufs + (C * PARALLEL_CHUNK_SIZE);
+                chunks[C].pages = NULL;
+        }
+
+        /*
+         * Start every worker on its first chunk
+         */
+        for (C = 0; C < nrChunks; C++) {
+                count = min_t(size_t, requestedCount - queued, PARALLEL_CHUNK_SIZE);
+                err = bulk_throttle(count);
+                if (err)
+                        break;
+                chunks[C].count = count;
+                queued += count;
+                queue_work(srandom_wq, &chunks[C].work);
+        }
+
+        /*
+         * Copy the chunks out in order.  Each slot is requeued for a later chunk as soon as it is copied.
+         * After a signal nothing more is queued, and the chunks already queued are still copied.
+         */
+        for (C = 0; copied < queued; C = (C + 1) % nrChunks) {
+                flush_work(&chunks[C].work);
+
+                if (COPY_TO_USER(buf + copied, chunks[C].buf, chunks[C].count)) {
+                        err = -EFAULT;
+                        break;
+                }
+                copied += chunks[C].count;
+
+                if (!err && queued < requestedCount) {
+                        count = min_t(size_t, requestedCount - queued, PARALLEL_CHUNK_SIZE);
+                        err = bulk_throttle(count);
+                        if (err)
+                                continue;
+                        chunks[C].count = count;
+                        queued += count;
+                        queue_work(srandom_wq, &chunks[C].work);
+                }
+        }
+
+        /*
+         * Wait for anything still in flight (only after a failed copy) before freeing
+         */
+        for (C = 0; C < nrChunks; C++) {
+                flush_work(&chunks[C].work);
+        }
+
+        vfree(chunkBufs);
+        kfree(chunks);
+
+        return copied ? copied : err;
 }
 
 
+/*
+ * srandom_wq worker.  Generate one chunk of a parallel read.
+ */
+static void chunk_work(struct work_struct *work)
+{
+        struct srandom_chunk *chunk = container_of(work, struct srandom_chunk, work);
+
+        #ifdef SRANDOM_NOCACHE
+        if (chunk->pages) {
+                nocache_fill(chunk->pages, chunk->offset, chunk->count);
+                return;
+        }
+        #endif
+
+        srandom_fill(chunk->buf, chunk->count, 0);
+}
+
+
+/*
+ * No-cache bulk mode.  The user's pages are pinned and written with non-temporal
+ * stores, so a multi-GB stream does not pass through (and evict) the CPU caches.
+ * Only the arrays and generator state stay cache resident.  Large reads still use the workers.
+ * Returns the number of bytes written, stopping at the first page that can not be pinned
+ * (sdevice_read serves the rest through the copy paths) or at a signal.
+ */
+#ifdef SRANDOM_NOCACHE
+static ssize_t sdevice_read_nocache(char * buf, size_t requestedCount)
+{
+        struct page **pages;
+        struct srandom_chunk *chunks;
+        unsigned long addr;
+        size_t done = 0, batch, offset, chunkStart;
+        int nrPages, pinned, nrChunks, C, err = 0;
+        bool parallel = requestedCount >= PARALLEL_READ_MIN && srandom_wq && num_online_cpus() > 1;
+
+        pages  = kcalloc(DIV_ROUND_UP(NOCACHE_BATCH_SIZE, PAGE_SIZE) + 1, sizeof(struct page *), GFP_KERNEL|__GFP_NOWARN);
+        chunks = kcalloc(DIV_ROUND_UP(NOCACHE_BATCH_SIZE, PARALLEL_CHUNK_SIZE), sizeof(struct srandom_chunk), GFP_KERNEL|__GFP_NOWARN);
+        if (!pages || !chunks) {
+                kfree(pages);
+                kfree(chunks);
+                return 0;
+        }
+
+        while (done < requestedCount) {
+                addr    = (unsigned long)buf + done;
+                offset  = addr & ~PAGE_MASK;
+                batch   = min_t(size_t, requestedCount - done, NOCACHE_BATCH_SIZE);
+                nrPages = DIV_ROUND_UP(offset + batch, PAGE_SIZE);
+
+                pinned = pin_user_pages_fast(addr & PAGE_MASK, nrPages, FOLL_WRITE, pages);
+                if (pinned <= 0)
+                        break;
+                if (pinned < nrPages)
+                        batch = (pinned * PAGE_SIZE) - offset;
+
+                err = bulk_throttle(batch);
+                if (err) {
+                        unpin_user_pages(pages, pinned);
+                        break;
+                }
+
+                if (parallel) {
+                        nrChunks = DIV_ROUND_UP(batch, PARALLEL_CHUNK_SIZE);
+                        for (C = 0; C < nrChunks; C++) {
+                                chunkStart       = offset + (C * PARALLEL_CHUNK_SIZE);
+                                INIT_WORK(&chunks[C].work, chunk_work);
+                                chunks[C].pages  = pages + (chunkStart >> PAGE_SHIFT);
+                                chunks[C].offset = chunkStart & ~PAGE_MASK;
+                                chunks[C].count  = min_t(size_t, batch - (C * PARALLEL_CHUNK_SIZE), PARALLEL_CHUNK_SIZE);
+                                queue_work(srandom_wq, &chunks[C].work);
+                        }
+                        for (C = 0; C < nrChunks; C++) {
+                                flush_work(&chunks[C].work);
+                        }
+                } else {
+                        nocache_fill(pages, offset, batch);
+                }
+
+                unpin_user_pages_dirty_lock(pages, pinned, true);
+                done += batch;
+
+                if (pinned < nrPages)
+                        break;
+                cond_resched();
+        }
+
+        kfree(chunks);
+        kfree(pages);
+
+        return done ? done : err;
+}
+
+
+/*
+ * Fill count bytes of pinned pages, starting offset bytes into pages[0], with non-temporal stores.
+ */
+static void nocache_fill(struct page **pages, size_t offset, size_t count)
+{
+        uint8_t block[512];
+        uint8_t *kaddr;
+        size_t pos, chunk;
+
+        while (count > 0) {
+                kaddr = kmap_local_page(*pages);
+                for (pos = offset; pos < PAGE_SIZE && count > 0; pos += chunk) {
+                        chunk = min_t(size_t, min_t(size_t, count, PAGE_SIZE - pos), sizeof(block));
+                        srandom_fill(block, chunk, 0);
+                        memcpy_flushcache(kaddr + pos, block, chunk);
+                        count -= chunk;
+                }
+                kunmap_local(kaddr);
+
+                pages++;
+                offset = 0;
+        }
+
+        // Order the non-temporal stores before the pages are unpinned and read
+        wmb();
+}
+#endif
+
+
 /*
  * Called when someone tries to write to /dev/srandom device
  */
@@ -397,25 +1038,255 @@ static ssize_t sdevice_write(struct file *file, const char __user *buf, size_t r
 
 
 /*
- *  Get the next available buffer
+ * Fill dst with count random bytes, one prngArrays block at a time.
+ * small callers may use the arrays reserved for small reads.
+ * Never sleeps, so it is safe in atomic (softirq/hardirq) context.
  */
-uint8_t get_next_buffer(void) {
-        uint8_t next;
+static void srandom_fill(uint8_t *dst, size_t count, bool small)
+{
+        uint8_t buffer_id;
+        size_t chunk;
+        unsigned long flags;
+        int failed;
+        unsigned int sampleRate;
+        #if ! ULTRA_HIGH_SPEED_MODE
+        struct chacha_context cctx;
+        uint64_t counter;
+        #endif
 
-        next = (uint8_t)lcg_fast() >> 2;
+        while (count > 0) {
+                chunk = min_t(size_t, count, 512);
 
-        while (mutex_lock_interruptible(&ArrBusy_mutex));
-        while (ArraysBusyFlags[next] != 0) {
-                next += 1;
-                if (next >= numberOfRndArrays) {
-                        next = 0;
+                /*
+                 * Interrupts stay off while a block is held, so a holder can
+                 * never be stalled by an atomic caller spinning on this CPU.
+                 */
+                local_irq_save(flags);
+                buffer_id = get_next_buffer(small);
+                if (unlikely(!ArraysInitFlags[buffer_id]))
+                        init_sarray(buffer_id);
+                this_cpu_inc(generatedCount);
+
+                /*
+                 * Continuous health test on a sample of the served blocks
+                 */
+                sampleRate = READ_ONCE(health_sample_rate);
+                if (sampleRate &&
+                    (this_cpu_inc_return(healthSampleCount) % sampleRate) == 0) {
+                        failed = health_test(buffer_id);
+                        if (unlikely(failed))
+                                health_failed(buffer_id, failed);
                 }
+
+                #ifdef DEBUG_READ
+                printk(KERN_INFO "[srandom] srandom_fill buffer_id:%d\n", buffer_id);
+                #endif
+
+                memcpy(dst, prngArrays[buffer_id], chunk);
+
+                #if ULTRA_HIGH_SPEED_MODE
+                // UHS mode will update the prngArrays block with new values for next request.
+                update_sarray(buffer_id);
+                #endif
+
+                release_buffer(buffer_id);
+                local_irq_restore(flags);
+
+                //  Use Chacha to cipher the block.
+                //  Only reserving the key stream range is serialized, the cipher runs on a private context.
+                #if ! ULTRA_HIGH_SPEED_MODE
+                spin_lock_irqsave(&chacha_lock, flags);
+                counter = chacha_counter;
+                chacha_counter += DIV_ROUND_UP(chunk, 64);
+                spin_unlock_irqrestore(&chacha_lock, flags);
+
+                chacha_init_context(&cctx, chacha_key, chacha_nonce, counter);
+                chacha_xor(&cctx, dst, chunk);
+                #endif
+
+                dst   += chunk;
+                count -= chunk;
+        }
+}
+
+
+/*
+ * Fill dst straight from this CPU's generator state, without taking an array.
+ * For small, frequent requests where a whole array update would cost more than the data.
+ * Interrupts are off while the state is updated, FAST_FILL_IRQ_MAX bytes at a time.  NMIs are
+ * not, so this must not be called from NMI context.
+ * ChaCha mode always goes through the arrays, so every byte is ciphered.
+ */
+static void srandom_fill_fast(uint8_t *dst, size_t count)
+{
+        #if ULTRA_HIGH_SPEED_MODE
+        uint64_t value;
+        size_t chunk, batch;
+        unsigned long flags;
+
+        while (count > 0) {
+                batch = min_t(size_t, count, FAST_FILL_IRQ_MAX);
+                count -= batch;
+
+                local_irq_save(flags);
+                while (batch > 0) {
+                        value = wyhash64() ^ xoshiro256pp();
+                        chunk = min_t(size_t, batch, sizeof(value));
+                        memcpy(dst, &value, chunk);
+
+                        dst   += chunk;
+                        batch -= chunk;
+                }
+                local_irq_restore(flags);
+        }
+        #else
+        srandom_fill(dst, count, count <= SMALL_READ_MAX);
+        #endif
+}
+
+
+/*
+ *  Get the next available buffer.
+ *  Small reads start in the reserved arrays and may take any free one.  Bulk reads never take a reserved array.
+ */
+uint8_t get_next_buffer(bool small) {
+        uint8_t next, range;
+        unsigned long flags;
+        int C;
+
+        spin_lock_irqsave(&ArrBusy_lock, flags);
+        if (small) {
+                range = numberOfRndArrays;
+                next  = (numberOfRndArrays - RESERVED_SMALL_ARRAYS) + ((uint8_t)lcg_fast() % RESERVED_SMALL_ARRAYS);
+        } else {
+                range = numberOfRndArrays - RESERVED_SMALL_ARRAYS;
+                next  = (uint8_t)lcg_fast() % range;
         }
 
-        ArraysBusyFlags[next] = 1;
-        mutex_unlock(&ArrBusy_mutex);
+        for (;;) {
+                for (C = 0; C < range; C++) {
+                        if (ArraysBusyFlags[next] == 0) {
+                                ArraysBusyFlags[next] = 1;
+                                spin_unlock_irqrestore(&ArrBusy_lock, flags);
+                                return next;
+                        }
+                        next += 1;
+                        if (next >= range) {
+                                next = 0;
+                        }
+                }
 
-        return next;
+                /*
+                 * Every block is busy.  Drop the lock so a holder can release one.
+                 */
+                spin_unlock_irqrestore(&ArrBusy_lock, flags);
+                cpu_relax();
+                spin_lock_irqsave(&ArrBusy_lock, flags);
+        }
+}
+
+
+/*
+ *  Release a buffer taken with get_next_buffer
+ */
+void release_buffer(uint8_t buffer_id) {
+        unsigned long flags;
+
+        spin_lock_irqsave(&ArrBusy_lock, flags);
+        ArraysBusyFlags[buffer_id] = 0;
+        spin_unlock_irqrestore(&ArrBusy_lock, flags);
+}
+
+
+/*
+ *  Health test a block before it is served.  Returns a mask of HEALTH_FAIL_* bits.
+ *  The caller must own buffer_id and have interrupts off (this CPU's generator state is checked).
+ */
+int health_test(int buffer_id) {
+        const uint64_t *words = prngArrays[buffer_id];
+        const uint8_t *bytes = (const uint8_t *)prngArrays[buffer_id];
+        struct srandom_state *state = this_cpu_ptr(&srandom_states);
+        int C, ones = 0, same = 0, failed = 0;
+
+        atomic64_inc(&healthSamples);
+
+        /*
+         * Repetition count (two equal consecutive 64 bit words) and monobit, one word at a time
+         */
+        ones = hweight64(words[0]);
+        for (C = 1; C < 64; C++) {
+                if (words[C] == words[C - 1])
+                        failed |= HEALTH_FAIL_RCT;
+                ones += hweight64(words[C]);
+        }
+        if (abs(ones - 2048) > HEALTH_MONOBIT_LIMIT)
+                failed |= HEALTH_FAIL_MONOBIT;
+
+        /*
+         * Adaptive proportion.  How often the first byte occurs in the 512 byte window.
+         */
+        for (C = 0; C < 512; C++) {
+                same += (bytes[C] == bytes[0]);
+        }
+        if (same >= HEALTH_APT_CUTOFF)
+                failed |= HEALTH_FAIL_APT;
+
+        /*
+         * Stuck state.  An all zero xoshiro state never leaves zero.
+         * In UHS mode every served block runs update_sarray, which always advances wyhash64, so it must
+         * have moved since the last test.  xoshiro is not checked for movement, update_sarray may skip it.
+         */
+        if ((state->xoroshiro_s[0] | state->xoroshiro_s[1] | state->xoroshiro_s[2] | state->xoroshiro_s[3]) == 0)
+                failed |= HEALTH_FAIL_STUCK;
+        #if ULTRA_HIGH_SPEED_MODE
+        if (state->wyhash64_x == state->last_wyhash64_x)
+                failed |= HEALTH_FAIL_STUCK;
+        #endif
+        state->last_wyhash64_x = state->wyhash64_x;
+
+        return failed;
+}
+
+
+/*
+ *  A health test failed.  Reseed this CPU's generators and refill the block before it is served.
+ */
+void health_failed(int buffer_id, int failed) {
+        struct srandom_state *state = this_cpu_ptr(&srandom_states);
+
+        if (failed & HEALTH_FAIL_RCT)
+                atomic_inc(&healthFailRCT);
+        if (failed & HEALTH_FAIL_APT)
+                atomic_inc(&healthFailAPT);
+        if (failed & HEALTH_FAIL_MONOBIT)
+                atomic_inc(&healthFailMonobit);
+        if (failed & HEALTH_FAIL_STUCK)
+                atomic_inc(&healthFailStuck);
+
+        printk(KERN_INFO "[srandom] health_failed buffer_id:%d failed:%d, reseeding..\n", buffer_id, failed);
+
+        get_random_bytes(state, sizeof(struct srandom_state));
+        atomic_inc(&healthReseeds);
+
+        init_sarray(buffer_id);
+}
+
+
+/*
+ *  Fill a block on its first use.  The caller must own buffer_id (get_next_buffer).
+ */
+void init_sarray(int buffer_id) {
+        int16_t C;
+        unsigned long flags;
+
+        spin_lock_irqsave(&UpArr_lock[buffer_id], flags);
+        for (C = 0;C < rndArraySize;C++) {
+                prngArrays[buffer_id][C] = wyhash64() ^ xoshiro256pp();
+        }
+        spin_unlock_irqrestore(&UpArr_lock[buffer_id], flags);
+
+        update_sarray(buffer_id);
+        ArraysInitFlags[buffer_id] = 1;
 }
 
 
@@ -423,6 +1294,13 @@ void update_sarray(int buffer_id) {
         int16_t C;
         int64_t X[2], Z[2], temp;
         int8_t mixer;
+        unsigned long flags;
+
+        /*
+         * This must run exclusivly for this specific buffer.  Holding the lock also
+         * keeps this CPU's generator state to ourselves.
+         */
+        spin_lock_irqsave(&UpArr_lock[buffer_id], flags);
 
         mixer = (uint8_t)lcg_fast();
         if ((mixer & 1) == 1) {
@@ -437,11 +1315,6 @@ void update_sarray(int buffer_id) {
                 Z[1] = xoshiro256pp();
         }
 
-        /*
-         * This must run exclusivly for this specific buffer
-         */
-        while (mutex_lock_interruptible(&UpArr_mutex[buffer_id]));
-
         for (C = 0; C < (rndArraySize -4); C = C + 4) {
                 mixer = (uint8_t)lcg_fast();
                 X[0]  = wyhash64();
@@ -455,7 +1328,7 @@ void update_sarray(int buffer_id) {
 
         shuffle_sarray(buffer_id);
 
-        mutex_unlock(&UpArr_mutex[buffer_id]);
+        spin_unlock_irqrestore(&UpArr_lock[buffer_id], flags);
 
         #ifdef DEBUG_UPDATE_ARRAYS
         printk(KERN_INFO "[srandom] update_sarray buffer_id:%d, X:%llu, Y:%llu, Z1:%llu, Z2:%llu, Z3:%llu,\n", buffer_id, X, Y, Z1, Z2, Z3);
@@ -535,13 +1408,14 @@ inline void shuffle_sarray(int buffer_id)
  */
 //https://lemire.me/blog/2019/03/19/the-fastest-conventional-random-number-generator-that-can-pass-big-crush/
 uint64_t wyhash64(void) {
+        struct srandom_state *state = this_cpu_ptr(&srandom_states);
         __uint128_t tmp;
         uint64_t m1;
         uint64_t m2;
 
-        wyhash64_x += 0x60bee2bee120fc15;
+        state->wyhash64_x += 0x60bee2bee120fc15;
 
-        tmp = (__uint128_t) wyhash64_x * 0xa3b195354a39b70d;
+        tmp = (__uint128_t) state->wyhash64_x * 0xa3b195354a39b70d;
         m1 = (tmp >> 64) ^ tmp;
         tmp = (__uint128_t)m1 * 0x1b03738712fad5c9;
         m2 = (tmp >> 64) ^ tmp;
@@ -550,12 +1424,16 @@ uint64_t wyhash64(void) {
 
 // Fast LCG for in-module instance (maximum speed)
 uint64_t lcg_fast(void) {
-        lcg_state = lcg_state * 6364136223846793005ULL + 1442695040888963407ULL;
-        return lcg_state;
+        struct srandom_state *state = this_cpu_ptr(&srandom_states);
+
+        state->lcg_state = state->lcg_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return state->lcg_state;
 }
 
 // https://prng.di.unimi.it/
 uint64_t xoshiro256pp(void) {
+        uint64_t *xoroshiro_s = this_cpu_ptr(&srandom_states)->xoroshiro_s;
+
         const uint64_t result = rotl(xoroshiro_s[0] + xoroshiro_s[3], 23) + xoroshiro_s[0];
 
         const uint64_t t = xoroshiro_s[1] << 17;
@@ -622,7 +1500,9 @@ int work_thread(void *data)
                         buffer_id = 0;
                 }
 
-                update_sarray(buffer_id);
+                // Arrays not used yet are filled on first use instead
+                if (ArraysInitFlags[buffer_id])
+                        update_sarray(buffer_id);
 
                 #ifdef DEBUG_THREAD
                 printk(KERN_INFO "[srandom] work_thread buffer_id:%d\n", buffer_id);
@@ -635,11 +1515,112 @@ int work_thread(void *data)
 
 
 
+/*
+ * In-kernel API.  Both are safe to call from atomic (softirq/hardirq) context.
+ */
+void srandom_get_bytes(void *buf, size_t nbytes)
+{
+        srandom_fill(buf, nbytes, nbytes <= SMALL_READ_MAX);
+}
+EXPORT_SYMBOL_GPL(srandom_get_bytes);
+
+uint64_t srandom_u64(void)
+{
+        uint64_t value;
+
+        srandom_fill_fast((uint8_t *)&value, sizeof(value));
+        return value;
+}
+EXPORT_SYMBOL_GPL(srandom_u64);
+
+
+/*
+ * BPF kfuncs.  Backed by this CPU's generator state, lock free, so they are cheap enough to call per packet.
+ */
+#ifdef SRANDOM_BPF_KFUNCS
+__bpf_kfunc_start_defs();
+
+__bpf_kfunc u64 bpf_srandom_u64(void)
+{
+        return srandom_u64();
+}
+
+/*
+ * Fill buf (stack or map value memory) with buf__sz random bytes.
+ */
+__bpf_kfunc int bpf_srandom_fill(u8 *buf, u32 buf__sz)
+{
+        srandom_fill_fast(buf, buf__sz);
+        return 0;
+}
+
+__bpf_kfunc_end_defs();
+#endif
+
+
+/*
+ * crypto_rng callbacks
+ */
+#ifdef SRANDOM_CRYPTO_RNG
+int srandom_rng_generate(struct crypto_rng *tfm, const u8 *src, unsigned int slen, u8 *dst, unsigned int dlen)
+{
+        srandom_fill(dst, dlen, dlen <= SMALL_READ_MAX);
+        return 0;
+}
+
+/*
+ * srandom seeds itself from get_random_bytes at load, so a caller supplied seed is not needed.
+ */
+int srandom_rng_seed(struct crypto_rng *tfm, const u8 *seed, unsigned int slen)
+{
+        return 0;
+}
+#endif
+
+
+/*
+ * Print the latency of one read class, summed over all CPUs.
+ * p99 is the upper bound of the histogram bucket holding the 99th percentile.
+ */
+static void proc_latency(struct seq_file *m, const char *label, int readClass)
+{
+        struct read_latency *lat;
+        u64 count = 0, totalNs = 0, maxNs = 0, seen = 0, p99Ns = 0;
+        u64 hist[LATENCY_BUCKETS] = { 0 };
+        int cpu, b;
+
+        for_each_possible_cpu(cpu) {
+                lat = per_cpu_ptr(&readLatency[readClass], cpu);
+                count   += lat->count;
+                totalNs += lat->totalNs;
+                if (lat->maxNs > maxNs)
+                        maxNs = lat->maxNs;
+                for (b = 0; b < LATENCY_BUCKETS; b++) {
+                        hist[b] += lat->hist[b];
+                }
+        }
+
+        for (b = 0; b < LATENCY_BUCKETS && count; b++) {
+                seen += hist[b];
+                if (seen * 100 >= count * 99) {
+                        p99Ns = 2ULL << b;
+                        break;
+                }
+        }
+
+        seq_printf(m, "%sreads:%llu avg:%lluns p99<%lluns max:%lluns\n", label,
+                   count, count ? div64_u64(totalNs, count) : 0, p99Ns, maxNs);
+}
+
+
 /*
  * This function is called when reading /proc filesystem
  */
 int proc_read(struct seq_file *m, void *v)
 {
+        uint64_t generated = 0;
+        int cpu;
+
         seq_printf(m, "-----------------------:----------------------\n");
         seq_printf(m, "Device                 : /dev/"SDEVICE_NAME"\n");
         #if ULTRA_HIGH_SPEED_MODE
@@ -649,7 +1630,24 @@ int proc_read(struct seq_file *m, void *v)
         #endif
         seq_printf(m, "Current open count     : %d\n", atomic_read(&sdevOpenCurrent));
         seq_printf(m, "Total open count       : %d\n", atomic_read(&sdevOpenTotal));
-        seq_printf(m, "Total K bytes          : %llu\n",generatedCount / 2);
+        for_each_possible_cpu(cpu) {
+                generated += per_cpu(generatedCount, cpu);
+        }
+        seq_printf(m, "Total K bytes          : %llu\n",generated / 2);
+        seq_printf(m, "Module load time (us)  : %lld\n", loadTimeUs);
+        seq_printf(m, "Health sample rate     : 1 in %u blocks\n", health_sample_rate);
+        seq_printf(m, "Health samples         : %lld\n", (long long)atomic64_read(&healthSamples));
+        seq_printf(m, "Health fail RCT        : %d\n", atomic_read(&healthFailRCT));
+        seq_printf(m, "Health fail APT        : %d\n", atomic_read(&healthFailAPT));
+        seq_printf(m, "Health fail monobit    : %d\n", atomic_read(&healthFailMonobit));
+        seq_printf(m, "Health fail stuck      : %d\n", atomic_read(&healthFailStuck));
+        seq_printf(m, "Health reseeds         : %d\n", atomic_read(&healthReseeds));
+        seq_printf(m, "Bulk bandwidth cap     : %u MiB/s\n", bulk_bw_cap);
+        #ifdef SRANDOM_NOCACHE
+        seq_printf(m, "Bulk no-cache minimum  : %u bytes\n", bulk_nocache_min);
+        #endif
+        proc_latency(m, "Small read latency     : ", READ_CLASS_SMALL);
+        proc_latency(m, "Bulk read latency      : ", READ_CLASS_BULK);
         if (PAID == 0) {
                 seq_printf(m, "-----------------------:----------------------\n");
                 seq_printf(m, "Please support my work and efforts contributing\n");
@@ -675,6 +1673,89 @@ int proc_open(struct inode *inode, struct  file *file)
 }
 
 
+/*
+ * /proc/srandom_consumers.  Merge every CPU's table and list the consumers using the most bytes.
+ */
+static int consumer_cmp_key(const void *a, const void *b)
+{
+        const struct srandom_consumer *x = a, *y = b;
+
+        if (x->cgroupId != y->cgroupId)
+                return x->cgroupId < y->cgroupId ? -1 : 1;
+        return x->tgid - y->tgid;
+}
+
+static int consumer_cmp_bytes(const void *a, const void *b)
+{
+        const struct srandom_consumer *x = a, *y = b;
+
+        if (x->bytes != y->bytes)
+                return x->bytes > y->bytes ? -1 : 1;
+        return 0;
+}
+
+int consumers_proc_read(struct seq_file *m, void *v)
+{
+        struct consumer_table *table;
+        struct srandom_consumer *all, *slot, other = { 0 };
+        size_t nrAll = 0, nrMerged = 0, C;
+        int cpu;
+
+        if (!consumerTables)
+                return 0;
+
+        all = kvmalloc_array(num_possible_cpus() * CONSUMER_SLOTS, sizeof(struct srandom_consumer), GFP_KERNEL);
+        if (!all)
+                return -ENOMEM;
+
+        for_each_possible_cpu(cpu) {
+                table = per_cpu_ptr(consumerTables, cpu);
+                for (C = 0; C < CONSUMER_SLOTS; C++) {
+                        slot = &table->slots[C];
+                        if (READ_ONCE(slot->used))
+                                all[nrAll++] = *slot;
+                }
+                slot = &table->other;
+                other.bytes  += slot->bytes;
+                other.reads  += slot->reads;
+                other.readNs += slot->readNs;
+        }
+
+        /*
+         * Merge the same consumer from different CPUs, then order by bytes
+         */
+        sort(all, nrAll, sizeof(struct srandom_consumer), consumer_cmp_key, NULL);
+        for (C = 0; C < nrAll; C++) {
+                if (nrMerged && consumer_cmp_key(&all[nrMerged - 1], &all[C]) == 0) {
+                        all[nrMerged - 1].bytes  += all[C].bytes;
+                        all[nrMerged - 1].reads  += all[C].reads;
+                        all[nrMerged - 1].readNs += all[C].readNs;
+                } else {
+                        all[nrMerged++] = all[C];
+                }
+        }
+        sort(all, nrMerged, sizeof(struct srandom_consumer), consumer_cmp_bytes, NULL);
+
+        seq_printf(m, "%-20s %-8s %-16s %12s %14s %12s\n", "cgroup id", "tgid", "comm", "reads", "K bytes", "read ms");
+        for (C = 0; C < nrMerged && C < consumers_top_n; C++) {
+                seq_printf(m, "%-20llu %-8d %-16s %12llu %14llu %12llu\n", all[C].cgroupId, all[C].tgid, all[C].comm,
+                           all[C].reads, all[C].bytes >> 10, div_u64(all[C].readNs, NSEC_PER_MSEC));
+        }
+        if (other.reads)
+                seq_printf(m, "%-20s %-8s %-16s %12llu %14llu %12llu\n", "other", "-", "-",
+                           other.reads, other.bytes >> 10, div_u64(other.readNs, NSEC_PER_MSEC));
+
+        kvfree(all);
+        return 0;
+}
+
+
+int consumers_proc_open(struct inode *inode, struct  file *file)
+{
+        return single_open(file, consumers_proc_read, NULL);
+}
+
+
 /*
  *  ChaCha
  *  Adapted from: https://github.com/Ginurx/chacha20-c
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <linux/types.h>
+
+/*
+ * In-kernel API exported by the srandom module.
+ *
+ * Both functions never sleep and may be called from any context, including
+ * softirq and hardirq.  Link against srandom.ko (EXPORT_SYMBOL_GPL).
+ */
+
+void srandom_get_bytes(void *buf, size_t nbytes);
+uint64_t srandom_u64(void);
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+#  Measures the throughput cost of the continuous health tests: dd throughput with
+#  health_sample_rate=0 (off) against the given rate.  Needs root and the srandom module loaded.
+#
+#  Usage: tests/bench_health.sh [sample rate] [runs] [MiB per run]      (default 1024 5 4096)
+
+PATH=/usr/sbin:/usr/bin:/bin:/sbin
+export PATH
+export LC_ALL=C
+
+PARAM=/sys/module/srandom/parameters/health_sample_rate
+RATE=${1:-1024}
+RUNS=${2:-5}
+MIB=${3:-4096}
+
+if [ ! -f $PARAM ];then
+    echo "$PARAM not found, load the module first."
+    exit 1
+fi
+SAVED=$(cat $PARAM)
+trap 'echo $SAVED > $PARAM' EXIT
+
+# Prints MB/s of one dd run
+throughput(){
+    dd if=/dev/srandom of=/dev/null bs=64k count=$((MIB * 16)) 2>&1 | \
+        awk '/copied/ {for (i = 2; i <= NF; i++) if ($i == "s,") printf "%.0f\n", $1 / $(i - 1) / 1000000}'
+}
+
+median(){
+    sort -n | awk '{v[NR] = $1} END {print (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2}'
+}
+
+OFF=""
+ON=""
+for R in $(seq $RUNS);do
+    # Alternate the two settings, so drift (thermal, other load) hits both alike
+    echo 0 > $PARAM
+    OFF="$OFF $(throughput)"
+    echo $RATE > $PARAM
+    ON="$ON $(throughput)"
+done
+
+OFF_MED=$(echo $OFF | tr ' ' '\n' | median)
+ON_MED=$(echo $ON | tr ' ' '\n' | median)
+
+echo "health_sample_rate=0     MB/s:$OFF  median:$OFF_MED"
+echo "health_sample_rate=$RATE  MB/s:$ON  median:$ON_MED"
+awk -v off=$OFF_MED -v on=$ON_MED 'BEGIN {printf "Health test overhead: %.2f%%\n", off ? 100 * (off - on) / off : 0}'
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+#  Measures how much a bulk /dev/srandom reader disturbs the LLC of another workload, with the
+#  no-cache bulk mode on and off.  Needs root, perf, and the srandom module loaded on x86-64.
+#
+#  Usage: tests/bench_nocache.sh [workload command]
+#         (default: perf bench mem memcpy, a cache sensitive copy that fits in the LLC)
+
+PATH=/usr/sbin:/usr/bin:/bin:/sbin
+export PATH
+
+PARAM=/sys/module/srandom/parameters/bulk_nocache_min
+WORKLOAD=${*:-perf bench mem memcpy -s 2MB -l 5000}
+BULK="dd if=/dev/srandom of=/dev/null bs=1M"
+
+if [ ! -f $PARAM ];then
+    echo "$PARAM not found.  Load the module (no-cache mode needs x86-64 and kernel 5.11+)."
+    exit 1
+fi
+SAVED=$(cat $PARAM)
+trap 'echo $SAVED > $PARAM' EXIT
+
+measure(){
+    perf stat -x, -e LLC-loads,LLC-load-misses -- $WORKLOAD 2>&1 >/dev/null | \
+        awk -F, '/LLC-loads/ {l=$1} /LLC-load-misses/ {m=$1}
+                 END {printf "  LLC-loads:%s LLC-load-misses:%s miss rate:%.2f%%\n", l, m, l ? 100*m/l : 0}'
+}
+
+with_bulk(){
+    $BULK 2>/tmp/bench_nocache_dd.$$ &
+    DD=$!
+    sleep 1
+    measure
+    kill -INT $DD
+    wait $DD 2>/dev/null
+    echo -n "  dd: "
+    tail -1 /tmp/bench_nocache_dd.$$
+    rm -f /tmp/bench_nocache_dd.$$
+}
+
+echo "Workload: $WORKLOAD"
+echo
+echo "No bulk reader:"
+measure
+
+echo "Bulk reader, no-cache mode on (bulk_nocache_min=65536):"
+echo 65536 > $PARAM
+with_bulk
+
+echo "Bulk reader, no-cache mode off (bulk_nocache_min=0):"
+echo 0 > $PARAM
+with_bulk
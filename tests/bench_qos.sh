@@ -0,0 +1,47 @@
+#!/bin/bash
+
+#  Measures small read latency of /dev/srandom alone and with a bulk reader running.
+#  Needs python3 and the srandom module loaded.
+#
+#  Usage: tests/bench_qos.sh [small reads]      (default 1000000)
+
+PATH=/usr/sbin:/usr/bin:/bin:/sbin
+export PATH
+
+READS=${1:-1000000}
+
+small_reads(){
+    python3 - "$READS" <<'PY'
+import os, sys, time
+n = int(sys.argv[1])
+fd = os.open("/dev/srandom", os.O_RDONLY)
+lat = []
+for _ in range(n):
+    t = time.perf_counter_ns()
+    os.read(fd, 16)
+    lat.append(time.perf_counter_ns() - t)
+os.close(fd)
+lat.sort()
+print("  16 byte reads:%d p50:%dns p99:%dns max:%dns" % (n, lat[n // 2], lat[n * 99 // 100], lat[-1]))
+PY
+}
+
+if [ ! -c /dev/srandom ];then
+    echo "/dev/srandom not found, load the module first."
+    exit 1
+fi
+
+echo "Small reads alone:"
+small_reads
+
+echo "Small reads with a bulk reader (dd bs=64k):"
+dd if=/dev/srandom of=/dev/null bs=64k 2>/dev/null &
+DD=$!
+sleep 1
+small_reads
+kill $DD
+wait $DD 2>/dev/null
+
+echo
+echo "/proc/srandom (totals since load):"
+grep latency /proc/srandom
@@ -0,0 +1,45 @@
+/*
+ * Baseline for the kfunc benchmark in run.sh.  Does the same work as srandom_kfunc.bpf.c
+ * with bpf_get_prandom_u32, one 32 bit word per call.
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+#define FILL_SIZE 64
+
+struct result {
+        __u64 first;
+        __u64 second;
+        __u8 fill[FILL_SIZE];
+};
+
+struct {
+        __uint(type, BPF_MAP_TYPE_ARRAY);
+        __uint(max_entries, 1);
+        __type(key, __u32);
+        __type(value, struct result);
+} results SEC(".maps");
+
+SEC("xdp")
+int prandom_baseline(struct xdp_md *ctx)
+{
+        struct result *r;
+        __u32 *words;
+        __u32 key = 0;
+        int i;
+
+        r = bpf_map_lookup_elem(&results, &key);
+        if (!r)
+                return XDP_ABORTED;
+
+        r->first  = ((__u64)bpf_get_prandom_u32() << 32) | bpf_get_prandom_u32();
+        r->second = ((__u64)bpf_get_prandom_u32() << 32) | bpf_get_prandom_u32();
+
+        words = (__u32 *)r->fill;
+        for (i = 0; i < FILL_SIZE / 4; i++)
+                words[i] = bpf_get_prandom_u32();
+
+        return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,66 @@
+#!/bin/bash
+
+#  Builds and runs the srandom kfunc selftest, then benchmarks it against bpf_get_prandom_u32.
+#  Needs root, clang, bpftool, libbpf headers and the srandom module loaded in UHS mode on a
+#  6.9+ kernel with CONFIG_DEBUG_INFO_BTF_MODULES.
+#
+#  Usage: tests/bpf/run.sh [repeat]      (default repeat 10000000)
+
+PATH=/usr/sbin:/usr/bin:/bin:/sbin
+export PATH
+
+REPEAT=${1:-10000000}
+DIR=$(cd "$(dirname "$0")" && pwd)
+PIN=/sys/fs/bpf/srandom_test
+TMP=$(mktemp -d)
+
+cleanup(){
+    rm -rf $PIN "$TMP"
+}
+trap cleanup EXIT
+
+fail(){
+    echo "FAIL: $*"
+    exit 1
+}
+
+if [ ! -f /sys/kernel/btf/srandom ];then
+    fail "srandom module BTF not found (module not loaded, or built without BTF)"
+fi
+
+bpftool btf dump file /sys/kernel/btf/vmlinux format c > "$TMP/vmlinux.h" || fail "bpftool btf dump"
+
+for PROG in srandom_kfunc prandom_baseline;do
+    clang -O2 -g -target bpf -I"$TMP" -c "$DIR/$PROG.bpf.c" -o "$TMP/$PROG.o" || fail "building $PROG"
+done
+
+mkdir -p $PIN
+for PROG in srandom_kfunc prandom_baseline;do
+    bpftool prog load "$TMP/$PROG.o" $PIN/$PROG type xdp pinmaps $PIN/${PROG}_maps || fail "loading $PROG"
+done
+
+# Minimal Ethernet frame, XDP test runs need at least 14 bytes
+head -c 64 /dev/zero > "$TMP/pkt.bin"
+
+run_once(){
+    bpftool prog run pinned $PIN/srandom_kfunc data_in "$TMP/pkt.bin" repeat 1
+}
+
+dump_results(){
+    bpftool map dump pinned $PIN/srandom_kfunc_maps/results
+}
+
+# XDP_PASS is 2
+run_once | grep -q "Return value: 2" || fail "kfunc output was constant (XDP_ABORTED)"
+dump_results > "$TMP/first"
+run_once | grep -q "Return value: 2" || fail "kfunc output was constant (XDP_ABORTED)"
+dump_results > "$TMP/second"
+cmp -s "$TMP/first" "$TMP/second" && fail "kfunc output did not change between runs"
+echo "PASS: bpf_srandom_u64 and bpf_srandom_fill"
+
+echo
+echo "Benchmark, $REPEAT runs each (duration is per run):"
+for PROG in srandom_kfunc prandom_baseline;do
+    printf "%-20s" $PROG
+    bpftool prog run pinned $PIN/$PROG data_in "$TMP/pkt.bin" repeat $REPEAT | grep -i duration
+done
@@ -0,0 +1,57 @@
+/*
+ * Selftest for the srandom BPF kfuncs.  Calls bpf_srandom_u64 twice and bpf_srandom_fill once,
+ * stores the results in the "results" map and returns XDP_ABORTED when the output is constant,
+ * XDP_PASS otherwise.  Run by run.sh.
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+#define FILL_SIZE 64
+
+extern __u64 bpf_srandom_u64(void) __ksym;
+extern int bpf_srandom_fill(__u8 *buf, __u32 buf__sz) __ksym;
+
+struct result {
+        __u64 first;
+        __u64 second;
+        __u8 fill[FILL_SIZE];
+};
+
+struct {
+        __uint(type, BPF_MAP_TYPE_ARRAY);
+        __uint(max_entries, 1);
+        __type(key, __u32);
+        __type(value, struct result);
+} results SEC(".maps");
+
+SEC("xdp")
+int srandom_kfunc(struct xdp_md *ctx)
+{
+        struct result *r;
+        __u64 *words;
+        __u32 key = 0;
+        int i, same = 1;
+
+        r = bpf_map_lookup_elem(&results, &key);
+        if (!r)
+                return XDP_ABORTED;
+
+        r->first  = bpf_srandom_u64();
+        r->second = bpf_srandom_u64();
+        if (r->first == r->second)
+                return XDP_ABORTED;
+
+        if (bpf_srandom_fill(r->fill, FILL_SIZE))
+                return XDP_ABORTED;
+
+        words = (__u64 *)r->fill;
+        for (i = 1; i < FILL_SIZE / 8; i++)
+                if (words[i] != words[0])
+                        same = 0;
+        if (same)
+                return XDP_ABORTED;
+
+        return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "GPL";